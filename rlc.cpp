@@ -21,22 +21,98 @@
 #include "rlc.h"
 
 #include <stdexcept>
+#include <fstream>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <limits>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace nc
 {
 
 void memxor(char *a, const char *b, size_t size)
 {
-	unsigned long *la = reinterpret_cast<unsigned long*>(a);
-	const unsigned long *lb = reinterpret_cast<const unsigned long*>(b);
+	// Words go through memcpy so buffers may be unaligned, compilers emit plain loads and stores
 	const size_t n = size / sizeof(unsigned long);
 	for(size_t i = 0; i < n; ++i)
-		la[i]^= lb[i];
+	{
+		unsigned long la, lb;
+		std::memcpy(&la, a + i*sizeof(unsigned long), sizeof(la));
+		std::memcpy(&lb, b + i*sizeof(unsigned long), sizeof(lb));
+		la^= lb;
+		std::memcpy(a + i*sizeof(unsigned long), &la, sizeof(la));
+	}
 	for(size_t i = n*sizeof(unsigned long); i < size; ++i)
 		a[i]^= b[i];
 }
 
+static inline uint64_t rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+// Snapshot file layout, in native byte order:
+// header, rows table, dense coefficients of each row from its first component,
+// then payload rows aligned so they can be used in place once mapped.
+// Combinations collected for block decoding are stored as rows flagged pending.
+static const char SnapshotMagic[8] = { 'N', 'C', 'R', 'L', 'C', 'S', 'N', 'P' };
+static const uint32_t SnapshotVersion = 2;
+static const uint32_t SnapshotRowPending = 1;
+static const uint32_t SnapshotByteOrder = 0x01020304;
+static const uint64_t SnapshotAlignment = 64;
+
+struct SnapshotHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t componentsCount;	// counters are informative, load() derives them from rows
+	uint32_t decodedCount;
+	uint32_t decodedPrefix;
+	uint32_t rowsCount;
+	uint64_t rowsOffset;
+	uint64_t coeffsOffset;
+	uint64_t payloadOffset;
+	uint64_t fileSize;
+};
+
+struct SnapshotRow
+{
+	uint32_t pivot;
+	uint32_t first;
+	uint32_t count;
+	uint32_t flags;
+	uint64_t coeffsOffset;	// relative to coefficients
+	uint64_t dataOffset;	// absolute
+	uint64_t dataSize;
+};
+
+static inline uint64_t align(uint64_t offset)
+{
+	return (offset + SnapshotAlignment - 1) / SnapshotAlignment * SnapshotAlignment;
+}
+
+class Rlc::Mapping
+{
+public:
+	Mapping(void *addr, size_t size) : mAddr(addr), mSize(size) {}
+	~Mapping(void) { ::munmap(mAddr, mSize); }
+	
+	char *data(void) const { return static_cast<char*>(mAddr); }
+	size_t size(void) const { return mSize; }
+	
+private:
+	void *mAddr;
+	size_t mSize;
+};
+
 uint8_t *Rlc::MulTable = NULL;
 uint8_t *Rlc::InvTable = NULL;
 
@@ -115,10 +191,156 @@ uint8_t Rlc::gInv(uint8_t a)
 	return InvTable[a];
 }
 
-Rlc::Generator::Generator(uint64_t seed) :
-	mSeed(seed)
+void Rlc::gMulAdd(char *a, const char *b, uint8_t coeff, size_t size)
 {
+	if(coeff == 1)
+	{
+		memxor(a, b, size);
+		return;
+	}
+	
+	const uint8_t *row = MulTable + unsigned(coeff)*256;
+	for(size_t i = 0; i < size; ++i)
+		a[i]^= row[uint8_t(b[i])];
+}
 
+void Rlc::gMulData(char *a, uint8_t coeff, size_t size)
+{
+	const uint8_t *row = MulTable + unsigned(coeff)*256;
+	for(size_t i = 0; i < size; ++i)
+		a[i] = row[uint8_t(a[i])];
+}
+
+bool Rlc::gInvert(uint8_t *matrix, unsigned n)
+{
+	// Blocked Gauss-Jordan elimination on [A | I]: pivots are chosen on a panel of columns,
+	// then the panel transformation is applied to trailing columns tile by tile, as a product
+	// by the inverse of the pivot block followed by a rank-update of the other rows.
+	const unsigned PanelSize = 64;
+	const size_t TileSize = 1024;
+	const size_t w = 2*size_t(n);
+	
+	std::vector<uint8_t> m(n*w, 0);
+	for(unsigned i = 0; i < n; ++i)
+	{
+		std::copy(matrix + size_t(i)*n, matrix + size_t(i+1)*n, &m[i*w]);
+		m[i*w + n + i] = 1;
+	}
+	
+	std::vector<uint8_t> work(size_t(n)*PanelSize);
+	std::vector<uint8_t> panel(size_t(n)*PanelSize);
+	std::vector<uint8_t> pivots(PanelSize*2*PanelSize);
+	std::vector<uint8_t> tile(PanelSize*TileSize);
+	std::vector<uint8_t> swap(w);
+	
+	for(unsigned k0 = 0; k0 < n; k0+= PanelSize)
+	{
+		const unsigned kb = std::min(PanelSize, n - k0);
+		const unsigned rows = n - k0;
+		
+		// Choose pivot rows by forward elimination on a copy of the panel
+		for(unsigned r = 0; r < rows; ++r)
+			std::copy(&m[(k0+r)*w + k0], &m[(k0+r)*w + k0 + kb], &work[r*kb]);
+		
+		for(unsigned k = 0; k < kb; ++k)
+		{
+			unsigned p = k;
+			while(p < rows && !work[p*kb + k]) ++p;
+			if(p == rows)
+				return false;	// singular
+			
+			if(p != k)
+			{
+				std::swap_ranges(&work[p*kb], &work[(p+1)*kb], &work[k*kb]);
+				std::copy(&m[(k0+p)*w], &m[(k0+p+1)*w], &swap[0]);
+				std::copy(&m[(k0+k)*w], &m[(k0+k+1)*w], &m[(k0+p)*w]);
+				std::copy(&swap[0], &swap[w], &m[(k0+k)*w]);
+			}
+			
+			const uint8_t inv = gInv(work[k*kb + k]);
+			for(unsigned r = k+1; r < rows; ++r)
+			{
+				uint8_t f = gMul(work[r*kb + k], inv);
+				if(f) gMulAdd(reinterpret_cast<char*>(&work[r*kb + k]), reinterpret_cast<const char*>(&work[k*kb + k]), f, kb - k);
+			}
+		}
+		
+		// Keep the panel of the other rows for the rank-update
+		for(unsigned i = 0; i < n; ++i)
+			std::copy(&m[i*w + k0], &m[i*w + k0 + kb], &panel[i*kb]);
+		
+		// Invert the pivot block with unblocked Gauss-Jordan elimination on [D | I]
+		const unsigned pw = 2*kb;
+		std::fill(pivots.begin(), pivots.end(), 0);
+		for(unsigned j = 0; j < kb; ++j)
+		{
+			std::copy(&panel[(k0+j)*kb], &panel[(k0+j+1)*kb], &pivots[j*pw]);
+			pivots[j*pw + kb + j] = 1;
+		}
+		
+		for(unsigned k = 0; k < kb; ++k)
+		{
+			unsigned p = k;
+			while(!pivots[p*pw + k]) ++p;	// the block is invertible
+			if(p != k) std::swap_ranges(&pivots[p*pw], &pivots[(p+1)*pw], &pivots[k*pw]);
+			
+			gMulData(reinterpret_cast<char*>(&pivots[k*pw]), gInv(pivots[k*pw + k]), pw);
+			for(unsigned r = 0; r < kb; ++r)
+			{
+				uint8_t f = pivots[r*pw + k];
+				if(r != k && f) gMulAdd(reinterpret_cast<char*>(&pivots[r*pw]), reinterpret_cast<const char*>(&pivots[k*pw]), f, pw);
+			}
+		}
+		
+		// Update trailing columns, columns before the panel are already unit vectors
+		for(size_t c = k0 + kb; c < w; c+= TileSize)
+		{
+			const size_t tw = std::min(TileSize, w - c);
+			
+			// Pivot rows are multiplied by the inverse of the pivot block
+			std::fill(tile.begin(), tile.begin() + kb*tw, 0);
+			for(unsigned j = 0; j < kb; ++j)
+				for(unsigned l = 0; l < kb; ++l)
+				{
+					uint8_t f = pivots[j*pw + kb + l];
+					if(f) gMulAdd(reinterpret_cast<char*>(&tile[j*tw]), reinterpret_cast<const char*>(&m[(k0+l)*w + c]), f, tw);
+				}
+			
+			// Other rows are eliminated with the transformed pivot rows
+			for(unsigned i = 0; i < n; ++i)
+			{
+				if(i >= k0 && i < k0 + kb) continue;
+				for(unsigned l = 0; l < kb; ++l)
+				{
+					uint8_t f = panel[i*kb + l];
+					if(f) gMulAdd(reinterpret_cast<char*>(&m[i*w + c]), reinterpret_cast<const char*>(&tile[l*tw]), f, tw);
+				}
+			}
+			
+			for(unsigned j = 0; j < kb; ++j)
+				std::copy(&tile[j*tw], &tile[(j+1)*tw], &m[(k0+j)*w + c]);
+		}
+	}
+	
+	for(unsigned i = 0; i < n; ++i)
+		std::copy(&m[i*w + n], &m[(i+1)*w], matrix + size_t(i)*n);
+	
+	return true;
+}
+
+Rlc::Generator::Generator(uint64_t seed) :
+	mBuffer(0),
+	mAvailable(0)
+{
+	// Expand the seed with SplitMix64, so any seed including zero gives a valid state
+	for(int i = 0; i < 4; ++i)
+	{
+		seed+= UINT64_C(0x9E3779B97F4A7C15);
+		uint64_t z = seed;
+		z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+		z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+		mState[i] = z ^ (z >> 31);
+	}
 }
 
 Rlc::Generator::~Generator(void)
@@ -128,36 +350,81 @@ Rlc::Generator::~Generator(void)
 
 uint8_t Rlc::Generator::next(void)
 {
-	if(!mSeed) return 1;
-	
 	uint8_t value;
-	do {
-		// Knuth's 64-bit linear congruential generator
-		mSeed = uint64_t(mSeed*6364136223846793005L + 1442695040888963407L);
-		value = uint8_t(mSeed >> 56);
+	fill(&value, 1);
+	return value;
+}
+
+void Rlc::Generator::fill(uint8_t *coeffs, size_t n)
+{
+	// Output is the stream of nonzero bytes of successive 64-bit outputs, least significant first,
+	// so the sequence does not depend on the way it is split between calls
+	size_t i = 0;
+	while(i < n)
+	{
+		// Drain pending bytes first
+		while(mAvailable && i < n)
+		{
+			uint8_t value = uint8_t(mBuffer);
+			mBuffer>>= 8;
+			--mAvailable;
+			if(value) coeffs[i++] = value;	// zero is not a valid output
+		}
+
+		// Bulk path, branchless compaction of whole outputs
+		while(n - i >= 8)
+		{
+			uint64_t r = step();
+			for(int k = 0; k < 8; ++k)
+			{
+				uint8_t value = uint8_t(r >> (8*k));
+				coeffs[i] = value;
+				i+= (value != 0);
+			}
+		}
+
+		if(i < n)
+		{
+			mBuffer = step();
+			mAvailable = 8;
+		}
 	}
-	while(!mSeed || !value);	// zero is not a valid output
+}
 
-	return value;
+uint64_t Rlc::Generator::step(void)
+{
+	// xoshiro256** by Blackman and Vigna
+	const uint64_t result = rotl(mState[1]*5, 7)*9;
+	const uint64_t t = mState[1] << 17;
+	mState[2]^= mState[0];
+	mState[3]^= mState[1];
+	mState[1]^= mState[2];
+	mState[0]^= mState[3];
+	mState[2]^= t;
+	mState[3] = rotl(mState[3], 45);
+	return result;
 }
 
 Rlc::Combination::Combination(void) :
 	mData(NULL),
-	mSize(0)
+	mSize(0),
+	mMapped(false)
 {
 	
 }
 
 Rlc::Combination::Combination(const Combination &combination) :
 	mData(NULL),
-	mSize(0)
+	mSize(0),
+	mMapped(false)
 {
 	*this = combination;
 }
 
 Rlc::Combination::Combination(unsigned offset, const char *data, size_t size) :
 	mData(NULL),
-	mSize(0)
+	mSize(0),
+	mMapped(false)
 {
 	addComponent(offset, 1, data, size);
 }
@@ -298,13 +565,22 @@ size_t Rlc::Combination::codedSize(void) const
 void Rlc::Combination::clear(void)
 {
 	mComponents.clear();
-	delete[] mData;
+	if(!mMapped) delete[] mData;
 	mData = NULL;
 	mSize = 0;
+	mMapped = false;
 }
 
 Rlc::Combination &Rlc::Combination::operator=(const Combination &combination)
 {
+	// Never write to mapped data through assignment
+	if(mMapped && &combination != this)
+	{
+		mData = NULL;
+		mSize = 0;
+		mMapped = false;
+	}
+	
 	mComponents = combination.mComponents;
 	resize(combination.mSize);
 	std::copy(combination.mData, combination.mData + combination.mSize, mData);
@@ -395,16 +671,134 @@ void Rlc::Combination::resize(size_t size, bool zerofill)
 		if(zerofill && size > mSize)
 			std::fill(newData + mSize, newData + size, 0);
 		
-		delete[] mData;
+		if(!mMapped) delete[] mData;
 		mData = newData;
+		mMapped = false;
 		mSize = size;
 	}
 }
 
-Rlc::Rlc(uint64_t seed) :
+void Rlc::Combination::addComponents(const Combination &combination, uint8_t coeff)
+{
+	for(	std::map<unsigned, uint8_t>::const_iterator jt = combination.mComponents.begin();
+		jt != combination.mComponents.end();
+		++jt)
+	{
+		addComponent(jt->first, Rlc::gMul(jt->second, coeff));
+	}
+}
+
+void Rlc::Combination::mulComponents(uint8_t coeff)
+{
+	for(std::map<unsigned, uint8_t>::iterator it = mComponents.begin(); it != mComponents.end(); ++it)
+		it->second = Rlc::gMul(it->second, coeff);
+}
+
+Rlc::Feedback::Feedback(void) :
+	mRank(0),
+	mFrontier(0),
+	mSequence(0)
+{
+
+}
+
+Rlc::Feedback::~Feedback(void)
+{
+
+}
+
+unsigned Rlc::Feedback::rank(void) const
+{
+	return mRank;
+}
+
+unsigned Rlc::Feedback::frontier(void) const
+{
+	return mFrontier;
+}
+
+bool Rlc::Feedback::isMissing(unsigned offset) const
+{
+	if(offset < mFrontier || offset >= bitmapEnd())
+		return false;
+	
+	unsigned i = offset - mFrontier;
+	return (mBitmap[i/8] >> (i%8)) & 1;
+}
+
+unsigned Rlc::Feedback::bitmapEnd(void) const
+{
+	return mFrontier + unsigned(mBitmap.size())*8;
+}
+
+unsigned Rlc::Feedback::sequence(void) const
+{
+	return mSequence;
+}
+
+void Rlc::Feedback::setSequence(unsigned sequence)
+{
+	mSequence = sequence;
+}
+
+size_t Rlc::Feedback::serialize(char *buffer, size_t size) const
+{
+	// Rank, frontier, sequence, bitmap length, then bitmap, little-endian
+	const size_t header = 4 + 4 + 4 + 2;
+	if(size < header)
+		return 0;
+	
+	size_t length = std::min(std::min(mBitmap.size(), size - header), size_t(0xFFFF));
+	for(int i = 0; i < 4; ++i) buffer[i] = char(mRank >> (8*i));
+	for(int i = 0; i < 4; ++i) buffer[4+i] = char(mFrontier >> (8*i));
+	for(int i = 0; i < 4; ++i) buffer[8+i] = char(mSequence >> (8*i));
+	for(int i = 0; i < 2; ++i) buffer[12+i] = char(length >> (8*i));
+	std::copy(mBitmap.begin(), mBitmap.begin() + length, buffer + header);
+	return header + length;
+}
+
+bool Rlc::Feedback::deserialize(const char *buffer, size_t size)
+{
+	const size_t header = 4 + 4 + 4 + 2;
+	if(size < header)
+		return false;
+	
+	unsigned rank = 0, frontier = 0, sequence = 0;
+	size_t length = 0;
+	for(int i = 0; i < 4; ++i) rank|= unsigned(uint8_t(buffer[i])) << (8*i);
+	for(int i = 0; i < 4; ++i) frontier|= unsigned(uint8_t(buffer[4+i])) << (8*i);
+	for(int i = 0; i < 4; ++i) sequence|= unsigned(uint8_t(buffer[8+i])) << (8*i);
+	for(int i = 0; i < 2; ++i) length|= size_t(uint8_t(buffer[12+i])) << (8*i);
+	if(size < header + length || frontier > rank)
+		return false;
+	
+	mRank = rank;
+	mFrontier = frontier;
+	mSequence = sequence;
+	mBitmap.assign(buffer + header, buffer + header + length);
+	return true;
+}
+
+void Rlc::Feedback::clear(void)
+{
+	mBitmap.clear();
+	mRank = 0;
+	mFrontier = 0;
+	mSequence = 0;
+}
+
+Rlc::Rlc(uint64_t seed, bool systematic) :
 	mDecodedCount(0),
+	mDecodedPrefix(0),
 	mComponentsCount(0),
-	mGen(seed)
+	mGen(seed),
+	mGenerated(0),
+	mRemoteRank(0),
+	mRemoteFrontier(0),
+	mSystematicNext(0),
+	mSystematic(systematic),
+	mPendingRank(0),
+	mGenerationSize(0)
 {
 
 }
@@ -414,25 +808,156 @@ Rlc::~Rlc(void)
 	
 }
 
-int Rlc::add(const char *data, size_t size)
+int Rlc::add(const char *data, size_t size, unsigned priority)
 {
 	mCombinations[mComponentsCount].addComponent(mComponentsCount, 1, data, size);
+	
+	// The window of a priority class expands up to its last component
+	unsigned &end = mWindows[priority];
+	end = std::max(end, mComponentsCount + 1);
+	
 	return mComponentsCount++;
 }
 
 bool Rlc::generate(Combination &output)
+{
+	if(!generateWindow(output, mComponentsCount))
+		return false;
+	
+	++mGenerated;
+	return true;
+}
+
+bool Rlc::generate(Combination &output, unsigned priority)
+{
+	if(!generateWindow(output, windowSize(priority)))
+		return false;
+	
+	++mGenerated;
+	return true;
+}
+
+unsigned Rlc::windowSize(unsigned priority) const
+{
+	// Windows are nested: the window of a class includes the windows of higher priority classes
+	unsigned end = 0;
+	for(std::map<unsigned, unsigned>::const_iterator it = mWindows.begin();
+		it != mWindows.end() && it->first <= priority;
+		++it)
+	{
+		end = std::max(end, it->second);
+	}
+	
+	return end;
+}
+
+void Rlc::acknowledge(const Feedback &feedback)
+{
+	mRemoteRank = feedback.rank();
+	
+	// Retire components decoded by the sink
+	if(feedback.frontier() > mRemoteFrontier)
+	{
+		mRemoteFrontier = feedback.frontier();
+		mCombinations.erase(mCombinations.begin(), mCombinations.lower_bound(mRemoteFrontier));
+		mResent.erase(mResent.begin(), mResent.lower_bound(mRemoteFrontier));
+	}
+	
+	// Schedule missing components for uncoded retransmission
+	if(mSystematic && feedback.bitmapEnd() > feedback.frontier())
+	{
+		// Components not sent yet will be sent uncoded anyway, and a component already
+		// resent is scheduled again only if the sink received a later packet, as the
+		// feedback may predate the arrival of the resent component
+		mResend.clear();
+		for(unsigned i = feedback.frontier(); i < std::min(feedback.bitmapEnd(), mSystematicNext); ++i)
+		{
+			if(!feedback.isMissing(i))
+				continue;
+			
+			std::map<unsigned, unsigned>::const_iterator it = mResent.find(i);
+			if(it == mResent.end() || feedback.sequence() > it->second)
+				mResend.push_back(i);
+		}
+	}
+}
+
+unsigned Rlc::generatedCount(void) const
+{
+	return mGenerated;
+}
+
+bool Rlc::isComplete(void) const
+{
+	return mComponentsCount && mRemoteRank >= mComponentsCount;
+}
+
+bool Rlc::generateWindow(Combination &output, unsigned end)
 {	
 	output.clear();
 	
-	if(mCombinations.empty())
+	if(isComplete())
+		return false;	// the sink is full, sending would be redundant
+	
+	// In systematic mode, send missing components then new components uncoded
+	if(mSystematic)
+	{
+		std::map<unsigned, Combination>::const_iterator it;
+		std::list<unsigned>::iterator jt = mResend.begin();
+		while(jt != mResend.end())
+		{
+			if(*jt >= end)
+			{
+				++jt;
+				continue;
+			}
+			
+			it = mCombinations.find(*jt);
+			if(it != mCombinations.end() && !it->second.isCoded())
+			{
+				mResent[*jt] = mGenerated + 1;	// sequence number of output
+				mResend.erase(jt);
+				output = it->second;
+				return true;
+			}
+			
+			jt = mResend.erase(jt);
+		}
+		
+		it = mCombinations.lower_bound(mSystematicNext);
+		if(it != mCombinations.end() && it->first < end && !it->second.isCoded())
+		{
+			mSystematicNext = it->first + 1;
+			output = it->second;
+			return true;
+		}
+	}
+	
+	std::map<unsigned, Combination>::const_iterator first = mCombinations.begin();
+	std::map<unsigned, Combination>::const_iterator last = mCombinations.lower_bound(end);
+	if(last == first)
 		return false;
 	
-	for(std::map<unsigned, Combination>::const_iterator it = mCombinations.begin();
-		it != mCombinations.end();
+	// Draw all coefficients at once
+	mCoeffs.resize(std::distance(first, last));
+	mGen.fill(&mCoeffs[0], mCoeffs.size());
+	
+	// Accumulate scaled payloads directly into output, without temporary combinations
+	size_t size = 0;
+	for(std::map<unsigned, Combination>::const_iterator it = first; it != last; ++it)
+		size = std::max(size, it->second.mSize);
+	
+	output.resize(size, true);	// zerofill
+	
+	// Combinations pivot on their last component, so they all lie in the window
+	size_t i = 0;
+	for(std::map<unsigned, Combination>::const_iterator it = first;
+		it != last;
 		++it)
 	{
-		uint8_t coeff = mGen.next();
-		output+= it->second*coeff;
+		const uint8_t coeff = mCoeffs[i++];
+		gMulAdd(output.mData, it->second.mData, coeff, it->second.mSize);
+		output.addComponents(it->second, coeff);
 	}
 	
 	return true;
@@ -441,64 +966,169 @@ bool Rlc::generate(Combination &output)
 void Rlc::clear(void)
 {
 	mCombinations.clear();
+	mPending.clear();
+	mPendingRows.clear();
+	mPendingRank = 0;
+	mMapping.reset();
+	mWindows.clear();
+	mResend.clear();
+	mResent.clear();
+	mGenerated = 0;
 	mDecodedCount = 0;
+	mDecodedPrefix = 0;
 	mComponentsCount = 0;
+	mRemoteRank = 0;
+	mRemoteFrontier = 0;
+	mSystematicNext = 0;
 }
 
-bool Rlc::solve(Combination incoming)
+bool Rlc::solve(const Combination &incoming)
 {
-	if(incoming.isNull())
-		return false;
+	return solve(&incoming, 1) > 0;
+}
+
+unsigned Rlc::solve(const std::vector<Combination> &incoming)
+{
+	if(incoming.empty()) return 0;
+	return solve(&incoming[0], incoming.size());
+}
+
+void Rlc::setBlockDecoding(unsigned generationSize)
+{
+	// Works with systematic sources too, but uncoded symbols are then only delivered once
+	// the generation is complete, so incremental decoding is preferable for them
+	mGenerationSize = generationSize;
+}
+
+unsigned Rlc::solve(const Combination *incoming, size_t count)
+{
+	// Block decoding applies to a fresh generation
+	if(mGenerationSize && mCombinations.empty())
+		return solveBlock(incoming, count);
 	
-	mComponentsCount = std::max(mComponentsCount, incoming.lastComponent()+1);
+	// Payloads are processed by tiles of this size, so rows being combined stay in cache
+	const size_t TileSize = 4096;
 	
 	// ==== Gauss-Jordan elimination ====
+	// Elimination is carried out on coefficients for the whole batch first, while payload
+	// operations are recorded, then operations are replayed tile by tile on payloads.
 	
 	std::map<unsigned, Combination>::iterator it, jt;
-	std::map<unsigned, Combination>::reverse_iterator rit;
+	mOperations.clear();
 	
-	// Eliminate coordinates, so the system is triangular
-	for(unsigned i = incoming.firstComponent(); i <= incoming.lastComponent(); ++i)
+	Combination row;
+	unsigned innovative = 0;
+	unsigned lowest = 0;	// lowest new pivot
+	for(size_t k = 0; k < count; ++k)
 	{
-		uint8_t c = incoming.coeff(i);
-		if(c != 0)
+		if(incoming[k].isNull())
+			continue;
+		
+		mComponentsCount = std::max(mComponentsCount, incoming[k].lastComponent()+1);
+		row.mComponents = incoming[k].mComponents;
+		
+		// Payload is first copied from incoming combination
+		const size_t mark = mOperations.size();
+		Operation load = { NULL, &incoming[k], 0 };
+		mOperations.push_back(load);
+		
+		// Eliminate coordinates from the last one, so the system is triangular with combinations
+		// pivoting on their last component: this way, a prefix of the system with all pivots
+		// present has full rank, which allows to decode expanding windows early
+		while(!row.isNull())
 		{
+			unsigned i = row.lastComponent();
 			jt = mCombinations.find(i);
 			if(jt == mCombinations.end()) break;
-			incoming+= jt->second*c;
+			
+			uint8_t c = row.coeff(i);
+			row.addComponents(jt->second, c);
+			Operation op = { NULL, &jt->second, c };
+			mOperations.push_back(op);
+		}
+		
+		if(row.isNull())
+		{
+			mOperations.resize(mark);
+			continue;	// non-innovative combination
 		}
+		
+		// Insert incoming combination
+		unsigned pivot = row.lastComponent();
+		uint8_t c = gInv(row.coeff(pivot));
+		row.mulComponents(c);
+		Combination &inserted = mCombinations[pivot];
+		inserted.mComponents.swap(row.mComponents);
+		
+		if(c != 1)
+		{
+			Operation op = { NULL, NULL, c };
+			mOperations.push_back(op);
+		}
+		
+		for(size_t i = mark; i < mOperations.size(); ++i)
+			mOperations[i].dst = &inserted;
+		
+		if(!innovative || pivot < lowest) lowest = pivot;
+		++innovative;
 	}
 	
-	if(incoming.isNull())
-		return false;	// non-innovative combination
+	if(!innovative)
+		return 0;
 	
-	// Insert incoming combination
-	incoming/= incoming.coeff(incoming.firstComponent());
-	mCombinations[incoming.firstComponent()] = incoming;
-	
-	// Attempt to substitute to solve
-	rit = mCombinations.rbegin();
-	while(rit != mCombinations.rend())
+	// Attempt to substitute to solve, combinations with lower pivots are not affected
+	for(it = mCombinations.find(lowest); it != mCombinations.end(); ++it)
 	{
-		unsigned first = std::max(rit->second.firstComponent(), rit->first);
-		for(unsigned i = rit->second.lastComponent(); i > first; --i)
+		while(it->second.firstComponent() != it->first)
 		{
+			unsigned i = it->second.firstComponent();
 			jt = mCombinations.find(i);
-			if(jt != mCombinations.end())
+			if(jt == mCombinations.end() || jt->second.isCoded()) break;
+			
+			uint8_t c = it->second.coeff(i);
+			it->second.addComponents(jt->second, c);
+			Operation op = { &it->second, &jt->second, c };
+			mOperations.push_back(op);
+		}
+	}
+	
+	// Resize payloads in operations order, so bytes beyond the size of a source
+	// at the time of an operation are still zero when the operation is replayed
+	size_t maxSize = 0;
+	for(std::vector<Operation>::iterator op = mOperations.begin(); op != mOperations.end(); ++op)
+	{
+		if(op->src && op->dst->mSize < op->src->mSize)
+			op->dst->resize(op->src->mSize, true);	// zerofill
+		
+		maxSize = std::max(maxSize, op->dst->mSize);
+	}
+	
+	// Replay operations on payloads tile by tile
+	for(size_t offset = 0; offset < maxSize; offset+= TileSize)
+	{
+		for(std::vector<Operation>::const_iterator op = mOperations.begin(); op != mOperations.end(); ++op)
+		{
+			Combination *dst = op->dst;
+			if(offset >= dst->mSize) continue;
+			size_t size = std::min(TileSize, dst->mSize - offset);
+			
+			if(!op->src)
 			{
-				if(jt->second.isCoded()) break;
-				rit->second+= jt->second*rit->second.coeff(i);
+				gMulData(dst->mData + offset, op->coeff, size);
+				continue;
 			}
+			
+			if(offset >= op->src->mSize) continue;
+			size = std::min(size, op->src->mSize - offset);
+			
+			if(op->coeff == 0) std::copy(op->src->mData + offset, op->src->mData + offset + size, dst->mData + offset);
+			else gMulAdd(dst->mData + offset, op->src->mData + offset, op->coeff, size);
 		}
-
-		if(rit->second.lastComponent() != rit->first)
-			break;
-		
-		++rit;
 	}
 	
 	// Remove null components and count decoded
 	mDecodedCount = 0;
+	mDecodedPrefix = 0;
 	it = mCombinations.begin();
 	while(it != mCombinations.end())
 	{
@@ -509,13 +1139,119 @@ bool Rlc::solve(Combination incoming)
 		}
 		else {
 			if(!it->second.isCoded())
+			{
+				if(it->first == mDecodedPrefix && mDecodedPrefix == mDecodedCount)
+					++mDecodedPrefix;
+				
 				++mDecodedCount;
+			}
 			
 			++it;
 		}
 	}
 	
-	return true;	// incoming was innovative
+	return innovative;
+}
+
+unsigned Rlc::solveBlock(const Combination *incoming, size_t count)
+{
+	if(mPendingRows.size() < mGenerationSize)
+		mPendingRows.resize(mGenerationSize);
+	
+	std::vector<uint8_t> row;
+	unsigned innovative = 0;
+	for(size_t k = 0; k < count; ++k)
+	{
+		// Combinations beyond the expected generation are ignored
+		if(incoming[k].isNull() || incoming[k].lastComponent() >= mGenerationSize)
+			continue;
+		
+		mComponentsCount = std::max(mComponentsCount, incoming[k].lastComponent()+1);
+		
+		// Check rank on dense coefficients only, payloads are left untouched until decoding
+		row.assign(incoming[k].lastComponent()+1, 0);
+		for(std::map<unsigned, uint8_t>::const_iterator it = incoming[k].mComponents.begin(); it != incoming[k].mComponents.end(); ++it)
+			row[it->first] = it->second;
+		
+		unsigned pivot = unsigned(row.size());
+		while(pivot--)
+		{
+			const uint8_t c = row[pivot];
+			if(!c) continue;
+			if(mPendingRows[pivot].empty()) break;
+			gMulAdd(reinterpret_cast<char*>(&row[0]), reinterpret_cast<const char*>(&mPendingRows[pivot][0]), c, pivot+1);
+		}
+		
+		if(pivot == unsigned(-1))
+			continue;	// non-innovative combination
+		
+		row.resize(pivot+1);
+		gMulData(reinterpret_cast<char*>(&row[0]), gInv(row[pivot]), pivot+1);
+		mPendingRows[pivot].swap(row);
+		mPending.push_back(incoming[k]);
+		++innovative;
+		
+		// The generation is complete once its size is reached, not the highest component seen
+		if(++mPendingRank == mGenerationSize)
+		{
+			decodeBlock();
+			
+			// Remaining combinations go through regular elimination
+			return innovative + solve(incoming + k + 1, count - k - 1);
+		}
+	}
+	
+	return innovative;
+}
+
+void Rlc::decodeBlock(void)
+{
+	// Payload rows of the decoded matrix are computed by tiles of this size, so that
+	// the corresponding tiles of a block of incoming rows stay in cache
+	const unsigned BlockSize = 64;
+	const size_t TileSize = 2048;
+	
+	const unsigned n = mGenerationSize;
+	std::vector<uint8_t> a(size_t(n)*n, 0);
+	size_t size = 0;
+	for(unsigned r = 0; r < n; ++r)
+	{
+		const Combination &c = mPending[r];
+		for(std::map<unsigned, uint8_t>::const_iterator it = c.mComponents.begin(); it != c.mComponents.end(); ++it)
+			a[size_t(r)*n + it->first] = it->second;
+		
+		size = std::max(size, c.mSize);
+	}
+	
+	if(!gInvert(&a[0], n))
+		throw std::logic_error("Singular matrix in RLC block decoding");
+	
+	std::vector<Combination*> rows(n);
+	for(unsigned i = 0; i < n; ++i)
+	{
+		Combination &c = mCombinations[i];
+		c.addComponent(i, 1);
+		c.resize(size, true);	// zerofill
+		rows[i] = &c;
+	}
+	
+	// Decoded payloads are the product of the inverse by incoming payloads
+	for(size_t offset = 0; offset < size; offset+= TileSize)
+		for(unsigned k0 = 0; k0 < n; k0+= BlockSize)
+			for(unsigned i = 0; i < n; ++i)
+				for(unsigned k = k0; k < std::min(k0 + BlockSize, n); ++k)
+				{
+					const uint8_t f = a[size_t(i)*n + k];
+					const Combination &y = mPending[k];
+					if(!f || offset >= y.mSize) continue;
+					gMulAdd(rows[i]->mData + offset, y.mData + offset, f, std::min(TileSize, y.mSize - offset));
+				}
+	
+	mPending.clear();
+	mPendingRows.clear();
+	mPendingRank = 0;
+	mDecodedCount = n;
+	mDecodedPrefix = n;
 }
 
 int Rlc::get(std::list<const Combination*> &combinations) const
@@ -545,6 +1281,222 @@ int Rlc::getDecoded(std::list<const Combination*> &decoded) const
 	return decoded.size();
 }
 
+void Rlc::feedback(Feedback &output, bool missing) const
+{
+	output.clear();
+	output.mRank = seenCount();
+	output.mFrontier = mDecodedPrefix;
+	
+	if(missing && mComponentsCount > mDecodedPrefix)
+	{
+		const unsigned count = mComponentsCount - mDecodedPrefix;
+		output.mBitmap.assign((count + 7)/8, 0);
+		for(unsigned i = 0; i < count; ++i)
+			if(mCombinations.find(mDecodedPrefix + i) == mCombinations.end()
+				&& (mDecodedPrefix + i >= mPendingRows.size() || mPendingRows[mDecodedPrefix + i].empty()))
+				output.mBitmap[i/8]|= uint8_t(1 << (i%8));
+	}
+}
+
+void Rlc::save(const std::string &filename) const
+{
+	// Eliminated combinations by pivot, then pending combinations in arrival order
+	std::vector<const Combination*> combinations;
+	combinations.reserve(mCombinations.size() + mPending.size());
+	for(std::map<unsigned, Combination>::const_iterator it = mCombinations.begin();
+		it != mCombinations.end();
+		++it)
+	{
+		combinations.push_back(&it->second);
+	}
+	
+	for(size_t i = 0; i < mPending.size(); ++i)
+		combinations.push_back(&mPending[i]);
+	
+	SnapshotHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, SnapshotMagic, sizeof(SnapshotMagic));
+	header.version = SnapshotVersion;
+	header.byteOrder = SnapshotByteOrder;
+	header.componentsCount = mComponentsCount;
+	header.decodedCount = mDecodedCount;
+	header.decodedPrefix = mDecodedPrefix;
+	header.rowsCount = combinations.size();
+	header.rowsOffset = sizeof(SnapshotHeader);
+	header.coeffsOffset = header.rowsOffset + combinations.size()*sizeof(SnapshotRow);
+	
+	// Lay out rows
+	std::vector<SnapshotRow> rows;
+	rows.reserve(combinations.size());
+	uint64_t coeffsSize = 0;
+	for(size_t i = 0; i < combinations.size(); ++i)
+	{
+		const Combination &c = *combinations[i];
+		SnapshotRow row;
+		std::memset(&row, 0, sizeof(row));
+		row.pivot = c.lastComponent();
+		row.first = c.firstComponent();
+		row.count = c.componentsCount();
+		row.flags = (i >= mCombinations.size() ? SnapshotRowPending : 0);
+		row.coeffsOffset = coeffsSize;
+		row.dataSize = c.codedSize();
+		coeffsSize+= row.count;
+		rows.push_back(row);
+	}
+	
+	uint64_t offset = header.payloadOffset = align(header.coeffsOffset + coeffsSize);
+	for(size_t i = 0; i < rows.size(); ++i)
+	{
+		rows[i].dataOffset = offset;
+		offset = align(offset + rows[i].dataSize);
+	}
+	
+	header.fileSize = offset;
+	
+	// Write to a temporary file then rename it, so a mapped snapshot is never modified
+	const std::string tempname = filename + ".tmp";
+	std::ofstream file(tempname.c_str(), std::ios::binary | std::ios::trunc);
+	if(!file)
+		throw std::runtime_error("Unable to open snapshot file: " + tempname);
+	
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if(!rows.empty())
+		file.write(reinterpret_cast<const char*>(&rows[0]), rows.size()*sizeof(SnapshotRow));
+	
+	for(size_t i = 0; i < combinations.size(); ++i)
+	{
+		const Combination &c = *combinations[i];
+		for(unsigned j = 0; j < c.componentsCount(); ++j)
+			file.put(char(c.coeff(c.firstComponent() + j)));
+	}
+	
+	const char padding[SnapshotAlignment] = {};
+	uint64_t position = header.coeffsOffset + coeffsSize;
+	for(size_t i = 0; i < rows.size(); ++i)
+	{
+		file.write(padding, rows[i].dataOffset - position);
+		file.write(combinations[i]->data(), rows[i].dataSize);
+		position = rows[i].dataOffset + rows[i].dataSize;
+	}
+	
+	file.write(padding, header.fileSize - position);
+	file.close();
+	
+	if(!file || std::rename(tempname.c_str(), filename.c_str()) != 0)
+	{
+		std::remove(tempname.c_str());
+		throw std::runtime_error("Unable to write snapshot file: " + filename);
+	}
+}
+
+void Rlc::load(const std::string &filename)
+{
+	int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		throw std::runtime_error("Unable to open snapshot file: " + filename + ": " + std::strerror(errno));
+	
+	struct stat st;
+	if(::fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(SnapshotHeader))
+	{
+		::close(fd);
+		throw std::runtime_error("Invalid snapshot file: " + filename);
+	}
+	
+	// Private writable mapping: solving modifies payloads in place with copy-on-write
+	const size_t size = st.st_size;
+	void *addr = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(addr == MAP_FAILED)
+		throw std::runtime_error("Unable to map snapshot file: " + filename + ": " + std::strerror(errno));
+	
+	std::shared_ptr<Mapping> mapping(new Mapping(addr, size));
+	char *base = mapping->data();
+	
+	// Offsets come from the file, so bounds are checked without additions which could wrap around
+	const SnapshotHeader &header = *reinterpret_cast<const SnapshotHeader*>(base);
+	if(std::memcmp(header.magic, SnapshotMagic, sizeof(SnapshotMagic)) != 0
+		|| header.version != SnapshotVersion
+		|| header.byteOrder != SnapshotByteOrder
+		|| header.fileSize > size
+		|| header.payloadOffset > header.fileSize
+		|| header.coeffsOffset > header.payloadOffset
+		|| header.rowsOffset > header.coeffsOffset
+		|| header.rowsOffset < sizeof(SnapshotHeader)
+		|| header.rowsOffset % alignof(SnapshotRow) != 0
+		|| header.rowsCount > (header.coeffsOffset - header.rowsOffset)/sizeof(SnapshotRow))
+	{
+		throw std::runtime_error("Invalid snapshot file: " + filename);
+	}
+	
+	// Only coefficients are parsed, payloads are referenced in place
+	std::map<unsigned, Combination> combinations;
+	std::vector<Combination> pending;
+	const uint64_t coeffsSize = header.payloadOffset - header.coeffsOffset;
+	const SnapshotRow *rows = reinterpret_cast<const SnapshotRow*>(base + header.rowsOffset);
+	for(uint32_t i = 0; i < header.rowsCount; ++i)
+	{
+		const SnapshotRow &row = rows[i];
+		if(row.coeffsOffset > coeffsSize
+			|| row.count > coeffsSize - row.coeffsOffset
+			|| row.count > std::numeric_limits<uint32_t>::max() - row.first
+			|| row.dataOffset < header.payloadOffset
+			|| row.dataOffset > header.fileSize
+			|| row.dataSize > header.fileSize - row.dataOffset
+			|| row.dataOffset % SnapshotAlignment != 0
+			|| (row.flags & ~SnapshotRowPending) != 0
+			|| (!(row.flags & SnapshotRowPending) && combinations.find(row.pivot) != combinations.end()))
+		{
+			throw std::runtime_error("Invalid snapshot file: " + filename);
+		}
+		
+		Combination &c = (row.flags & SnapshotRowPending)
+			? *pending.insert(pending.end(), Combination())
+			: combinations.insert(combinations.end(), std::make_pair(row.pivot, Combination()))->second;
+		const char *coeffs = base + header.coeffsOffset + row.coeffsOffset;
+		for(uint32_t j = 0; j < row.count; ++j)
+			if(coeffs[j])
+				c.mComponents.insert(c.mComponents.end(), std::make_pair(row.first + j, uint8_t(coeffs[j])));
+		
+		if(c.isNull() || c.lastComponent() != row.pivot)
+			throw std::runtime_error("Invalid snapshot file: " + filename);
+		
+		if(row.dataSize)
+		{
+			c.mData = base + row.dataOffset;
+			c.mSize = row.dataSize;
+			c.mMapped = true;
+		}
+	}
+	
+	clear();
+	mCombinations.swap(combinations);
+	mMapping = mapping;
+	
+	// Counters are derived from rows rather than trusted from the header
+	if(!mCombinations.empty())
+		mComponentsCount = mCombinations.rbegin()->first + 1;
+	
+	for(std::map<unsigned, Combination>::const_iterator it = mCombinations.begin();
+		it != mCombinations.end();
+		++it)
+	{
+		if(!it->second.isCoded())
+		{
+			if(it->first == mDecodedPrefix && mDecodedPrefix == mDecodedCount)
+				++mDecodedPrefix;
+			
+			++mDecodedCount;
+		}
+	}
+	
+	// Pending combinations are collected again, copying their payloads, to rebuild rank check rows
+	if(!pending.empty() && solve(&pending[0], pending.size()) != pending.size())
+	{
+		clear();
+		throw std::runtime_error("Invalid snapshot file: " + filename);
+	}
+}
+
 size_t Rlc::dump(std::ostream &os) const
 {
 	size_t total = 0;
@@ -575,7 +1527,7 @@ void Rlc::print(std::ostream &os) const
 
 unsigned Rlc::seenCount(void) const
 {
-	return mCombinations.size();
+	return mCombinations.size() + mPendingRank;
 }
 
 unsigned Rlc::decodedCount(void) const
@@ -583,6 +1535,11 @@ unsigned Rlc::decodedCount(void) const
 	return mDecodedCount;
 }
 
+unsigned Rlc::decodedPrefix(void) const
+{
+	return mDecodedPrefix;
+}
+
 unsigned Rlc::componentsCount(void) const
 {
 	return mComponentsCount;
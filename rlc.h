@@ -24,14 +24,18 @@
 #include <iostream>
 #include <map>
 #include <list>
+#include <vector>
+#include <string>
+#include <memory>
 #include <cstddef>
+#include <stdint.h>
 
 namespace nc
 {
 
-// Modify if necessary
-typedef unsigned char  uint8_t;
-typedef unsigned long  uint64_t;
+// Fixed-width types, so seed-based coefficients are reproducible across platforms
+typedef ::uint8_t  uint8_t;
+typedef ::uint64_t uint64_t;
 
 // Optimized XOR
 void memxor(char *a, const char *b, size_t size);
@@ -81,59 +85,153 @@ public:
 		
 	private:
 		void resize(size_t size, bool zerofill = false);
+		void addComponents(const Combination &combination, uint8_t coeff);	// Add scaled components only
+		void mulComponents(uint8_t coeff);					// Multiply components only
 
 		std::map<unsigned, uint8_t> mComponents;
 		char *mData = NULL;
 		size_t mSize;
+		bool mMapped;	// mData points to a snapshot mapping and is not owned
+		
+		friend class Rlc;
 	};
 	
-	Rlc(uint64_t seed = 0);
+	// Pseudo-random coefficients generator
+	// The output for a given seed is the same on every platform, so a receiver can rebuild
+	// coefficients from a seed: xoshiro256** seeded with SplitMix64, whose 64-bit outputs are
+	// split into bytes least significant first, zero bytes being skipped. The sequence does
+	// not depend on how it is split between calls to next() and fill().
+	class Generator
+	{
+	public:
+		Generator(uint64_t seed);
+		~Generator(void);
+		uint8_t next(void);				// Return next nonzero coefficient
+		void fill(uint8_t *coeffs, size_t n);		// Fill with n nonzero coefficients
+	
+	private:
+		uint64_t step(void);
+
+		uint64_t mState[4];	// xoshiro256** state
+		uint64_t mBuffer;	// Pending output bytes, least significant first
+		unsigned mAvailable;	// Number of pending bytes in mBuffer
+	};
+	
+	// Sink feedback to the source
+	class Feedback
+	{
+	public:
+		Feedback(void);
+		~Feedback(void);
+		
+		unsigned rank(void) const;			// Seen combinations count at sink
+		unsigned frontier(void) const;			// Decoded prefix at sink
+		bool isMissing(unsigned offset) const;		// True if offset is known to miss a pivot at sink
+		unsigned bitmapEnd(void) const;			// End of offsets covered by the missing pivots bitmap
+		unsigned sequence(void) const;			// Latest generated count received by the sink, 0 if unknown
+		void setSequence(unsigned sequence);		// Echo the latest generated count received, see generatedCount()
+		
+		size_t serialize(char *buffer, size_t size) const;	// Write to buffer, bitmap is truncated if necessary, return written size
+		bool deserialize(const char *buffer, size_t size);	// Read from buffer, return false if invalid
+		
+		void clear(void);
+		
+	private:
+		std::vector<uint8_t> mBitmap;	// missing pivots from the frontier
+		unsigned mRank;
+		unsigned mFrontier;
+		unsigned mSequence;
+		
+		friend class Rlc;
+	};
+	
+	Rlc(uint64_t seed = 0, bool systematic = false);	// In systematic mode, symbols are sent uncoded first
 	~Rlc(void);
 	
 	// Source
-	int add(const char *data, size_t size);		// Add component from data	
-	bool generate(Combination &output);		// Generate combination
+	int add(const char *data, size_t size, unsigned priority = 0);	// Add component from data with priority class (0 is highest)
+	bool generate(Combination &output);		// Generate combination over all components
+	bool generate(Combination &output, unsigned priority);	// Generate combination over expanding window of priority class
+	unsigned windowSize(unsigned priority) const;	// Return number of components in window of priority class
+	void acknowledge(const Feedback &feedback);	// Handle sink feedback, retire decoded components
+	bool isComplete(void) const;			// Return true if the sink acknowledged all components
+	unsigned generatedCount(void) const;		// Return generated combinations count, the sequence number of the last one
 	void clear(void);				// Clear system
 
 	// Sink
-	bool solve(Combination incoming);		// Add combination and try to solve, return true if innovative
+	bool solve(const Combination &incoming);	// Add combination and try to solve, return true if innovative
+	unsigned solve(const Combination *incoming, size_t count);	// Add a batch of combinations and try to solve, return innovative count
+	unsigned solve(const std::vector<Combination> &incoming);	// Same with a vector
+	void setBlockDecoding(unsigned generationSize);	// Decode generations of this size at once by matrix inversion, 0 to disable
 	int get(std::list<const Combination*> &decoded) const;		// Get all combinations	
 	int getDecoded(std::list<const Combination*> &decoded) const;	// Get decoded combinations	
+	void feedback(Feedback &output, bool missing = false) const;	// Get feedback, with missing pivots bitmap if requested
 
 	unsigned seenCount(void) const;			// Return seen combinations count (degree)
 	unsigned decodedCount(void) const;		// Return decoded combinations count
+	unsigned decodedPrefix(void) const;		// Return count of consecutive decoded components from the first one
 	unsigned componentsCount(void) const;		// Return number of components in system
 	unsigned size(void) const { return seenCount(); }
 
+	// Snapshot
+	void save(const std::string &filename) const;	// Checkpoint system to file
+	void load(const std::string &filename);		// Restore system from file, payloads are mapped and not copied
+
 	size_t dump(std::ostream &os) const;		// Dump data from decoded combinations
 	void print(std::ostream &os) const;		// Print current system
 	
 private:
-	// Pseudo-random generator
-	class Generator
-	{
-	public:
-		Generator(uint64_t seed);
-		~Generator(void);
-		uint8_t next(void);
-	
-	private:
-		uint64_t mSeed;
-	};
+	bool generateWindow(Combination &output, unsigned end);	// Generate combination over components before end
+	unsigned solveBlock(const Combination *incoming, size_t count);	// Collect combinations until the generation is complete
+	void decodeBlock(void);						// Decode collected combinations
+
+	// Memory mapping of a snapshot file
+	class Mapping;
 
 	// GF(2^8) operations
 	static uint8_t gAdd(uint8_t a, uint8_t b);
 	static uint8_t gMul(uint8_t a, uint8_t b); 
 	static uint8_t gInv(uint8_t a);
+	static void gMulAdd(char *a, const char *b, uint8_t coeff, size_t size);	// a+= b*coeff
+	static void gMulData(char *a, uint8_t coeff, size_t size);		// a*= coeff
+	static bool gInvert(uint8_t *matrix, unsigned n);			// Invert n x n matrix in place
+	
+	// Payload operation recorded during elimination, replayed by tiles
+	struct Operation
+	{
+		Combination *dst;
+		const Combination *src;	// NULL to multiply dst by coeff
+		uint8_t coeff;		// 0 to copy src to dst
+	};
 	
 	// GF(2^8) operations tables
 	static uint8_t *MulTable;
 	static uint8_t *InvTable;
 
+	std::shared_ptr<Mapping> mMapping;		// snapshot mapping referenced by combinations
 	std::map<unsigned, Combination> mCombinations;	// combinations sorted by pivot component
+	std::map<unsigned, unsigned> mWindows;		// window end by priority class
 	unsigned mDecodedCount;
+	unsigned mDecodedPrefix;
 	unsigned mComponentsCount;
 	Generator mGen;
+	std::vector<uint8_t> mCoeffs;	// Coefficients buffer for generation
+	std::vector<Operation> mOperations;	// Operations buffer for solving
+	
+	// Source state from sink feedback
+	std::list<unsigned> mResend;	// missing components to resend uncoded
+	std::map<unsigned, unsigned> mResent;	// sequence number of the last uncoded resend by component
+	unsigned mGenerated;
+	unsigned mRemoteRank;
+	unsigned mRemoteFrontier;
+	unsigned mSystematicNext;	// next component to send uncoded
+	bool mSystematic;
+	
+	// Block decoding state
+	std::vector<Combination> mPending;		// collected innovative combinations
+	std::vector<std::vector<uint8_t> > mPendingRows;	// dense coefficients by pivot, to check rank
+	unsigned mPendingRank;
+	unsigned mGenerationSize;	// expected generation size for block decoding, 0 if disabled
 };
 
 std::ostream &operator<< (std::ostream &s, const Rlc::Combination &c);
@@ -0,0 +1,538 @@
+/****************************************************************************
+ *   Copyright (C) 2013-2016 by Paul-Louis Ageneau                          *
+ *   paul-louis (at) ageneau (dot) org                                      *
+ *                                                                          *
+ *   This file is part of NC-Simple.                                        *
+ *                                                                          *
+ *   NC-Simple is free software: you can redistribute it and/or modify      *
+ *   it under the terms of the GNU General Public License as published by   *
+ *   the Free Software Foundation, either version 3 of the License, or      *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   NC-Simple is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           *
+ *   GNU General Public License for more details.                           *
+ *                                                                          *
+ *   You should have received a copy of the GNU General Public License      *
+ *   along with NC-Simple. If not, see <http://www.gnu.org/licenses/>.      *
+ ****************************************************************************/
+
+// In-process simulator: a source Rlc transmits to sink Rlcs through lossy channels and relays
+
+#include "rlc.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+namespace
+{
+
+// Simulation parameters
+struct Params
+{
+	unsigned symbols;	// Number of source symbols
+	size_t size;		// Symbol size in bytes
+	unsigned interval;	// Ticks between arrivals of source symbols at source
+	double rate;		// Coded packets sent per tick
+	unsigned sinks;		// Number of sinks
+	unsigned hops;		// Number of relays between source and each sink
+	unsigned runs;		// Number of runs
+	unsigned maxTicks;	// Maximum duration of a run
+	bool block;		// Block decoding at sinks
+	unsigned priority;	// Number of high priority symbols at the beginning
+	double priorityRatio;	// Fraction of packets sent over the high priority window
+	std::string checkpoint;	// Snapshot file for sinks, empty if disabled
+	unsigned checkpointInterval;	// Ticks between sink checkpoints
+	
+	// Channel
+	double loss;		// Bernoulli loss probability, or loss probability in good state
+	double lossBad;		// Gilbert-Elliott loss probability in bad state
+	double goodToBad;	// Gilbert-Elliott transition probabilities, zero for Bernoulli
+	double badToGood;
+	unsigned delay;		// Propagation delay in ticks
+	double reorder;		// Probability of additional random delay
+	unsigned jitter;	// Maximum additional delay in ticks
+	double duplicate;	// Duplication probability
+	
+	nc::uint64_t seed;
+	bool fixedSeed;
+};
+
+// Reproducible pseudo-random numbers, independent from the standard library implementation
+class Random
+{
+public:
+	Random(nc::uint64_t seed) : mState(seed) {}
+	
+	nc::uint64_t next(void)
+	{
+		// SplitMix64
+		nc::uint64_t z = (mState+= UINT64_C(0x9E3779B97F4A7C15));
+		z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+		z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+		return z ^ (z >> 31);
+	}
+	
+	double uniform(void) { return double(next() >> 11) * (1.0/9007199254740992.0); }
+	bool bernoulli(double p) { return p > 0. && uniform() < p; }
+	unsigned range(unsigned n) { return n ? unsigned(next() % n) : 0; }
+	
+private:
+	nc::uint64_t mState;
+};
+
+// Lossy channel with delay, reordering and duplication
+class Channel
+{
+public:
+	Channel(const Params &params, nc::uint64_t seed) :
+		mParams(params),
+		mRandom(seed),
+		mBad(false),
+		mSent(0),
+		mLost(0)
+	{
+	
+	}
+	
+	void send(const nc::Rlc::Combination &c, unsigned now)
+	{
+		++mSent;
+		
+		// Gilbert-Elliott state transition, degenerates to Bernoulli if goodToBad is zero
+		if(mBad) mBad = !mRandom.bernoulli(mParams.badToGood);
+		else mBad = mRandom.bernoulli(mParams.goodToBad);
+		
+		if(mRandom.bernoulli(mBad ? mParams.lossBad : mParams.loss))
+		{
+			++mLost;
+			return;
+		}
+		
+		unsigned copies = 1 + (mRandom.bernoulli(mParams.duplicate) ? 1 : 0);
+		for(unsigned i = 0; i < copies; ++i)
+		{
+			unsigned time = now + mParams.delay;
+			if(mRandom.bernoulli(mParams.reorder))
+				time+= 1 + mRandom.range(mParams.jitter);
+			
+			mQueue.insert(std::make_pair(time, c));
+		}
+	}
+	
+	bool receive(nc::Rlc::Combination &c, unsigned now)
+	{
+		std::multimap<unsigned, nc::Rlc::Combination>::iterator it = mQueue.begin();
+		if(it == mQueue.end() || it->first > now)
+			return false;
+		
+		c = it->second;
+		mQueue.erase(it);
+		return true;
+	}
+	
+	unsigned sent(void) const { return mSent; }
+	unsigned lost(void) const { return mLost; }
+	
+private:
+	const Params &mParams;
+	Random mRandom;
+	std::multimap<unsigned, nc::Rlc::Combination> mQueue;	// packets by delivery time
+	bool mBad;
+	unsigned mSent;
+	unsigned mLost;
+};
+
+// Path from the source to a sink, with relays recoding packets
+struct Path
+{
+	std::vector<Channel*> channels;		// hops + 1 channels
+	std::vector<nc::Rlc*> relays;		// hops relays
+	nc::Rlc sink;
+	std::vector<int> decodedAt;		// decoding tick by symbol, -1 if not decoded
+	int prefixAt;				// decoding tick of the high priority prefix, -1 if not decoded
+	unsigned received;
+	unsigned decoded;
+	
+	Path(void) : prefixAt(-1), received(0), decoded(0) {}
+	
+	~Path(void)
+	{
+		for(size_t i = 0; i < channels.size(); ++i) delete channels[i];
+		for(size_t i = 0; i < relays.size(); ++i) delete relays[i];
+	}
+};
+
+// Aggregated results
+struct Results
+{
+	std::vector<unsigned> latencies;	// in ticks, from arrival at source to decoding
+	std::vector<unsigned> prefixLatencies;	// in ticks, from arrival of the last prefix symbol to prefix decoding
+	unsigned long long sent;
+	unsigned long long received;
+	unsigned long long delivered;		// delivered symbols
+	unsigned long long errors;		// corrupted or missing symbols
+	unsigned long long ticks;
+	double encodeTime;			// CPU time in seconds
+	double decodeTime;
+	
+	Results(void) : sent(0), received(0), delivered(0), errors(0), ticks(0), encodeTime(0.), decodeTime(0.) {}
+};
+
+double seconds(clock_t t)
+{
+	return double(t) / CLOCKS_PER_SEC;
+}
+
+void run(const Params &params, nc::uint64_t seed, Results &results)
+{
+	Random random(seed);
+	
+	// Generate source symbols
+	std::vector<std::string> symbols(params.symbols);
+	for(unsigned i = 0; i < params.symbols; ++i)
+	{
+		symbols[i].resize(params.size);
+		for(size_t j = 0; j < params.size; ++j)
+			symbols[i][j] = char(random.next());
+	}
+	
+	nc::Rlc source(random.next());
+	std::vector<unsigned> arrivals(params.symbols, 0);
+	
+	std::vector<Path*> paths(params.sinks);
+	for(unsigned s = 0; s < params.sinks; ++s)
+	{
+		Path *path = new Path;
+		for(unsigned h = 0; h <= params.hops; ++h)
+			path->channels.push_back(new Channel(params, random.next()));
+		for(unsigned h = 0; h < params.hops; ++h)
+			path->relays.push_back(new nc::Rlc(random.next()));
+		path->sink.setBlockDecoding(params.block ? params.symbols : 0);
+		path->decodedAt.resize(params.symbols, -1);
+		paths[s] = path;
+	}
+	
+	clock_t encodeTime = 0;
+	clock_t decodeTime = 0;
+	unsigned finished = 0;
+	double credit = 0.;
+	double priorityCredit = 0.;
+	unsigned tick = 0;
+	nc::Rlc::Combination c, r;
+	std::list<const nc::Rlc::Combination*> decoded;
+	
+	for(tick = 0; tick < params.maxTicks && finished < params.sinks; ++tick)
+	{
+		clock_t start = clock();
+		
+		// Source symbols arrival
+		unsigned added;
+		while((added = source.componentsCount()) < params.symbols && tick >= added*params.interval)
+		{
+			arrivals[added] = tick;
+			source.add(symbols[added].data(), symbols[added].size(), added < params.priority ? 0 : 1);
+		}
+		
+		// Send coded packets
+		credit+= params.rate;
+		while(credit >= 1.)
+		{
+			credit-= 1.;
+			
+			// A fraction of packets only covers the high priority window
+			bool generated;
+			if(params.priority && (priorityCredit+= params.priorityRatio) >= 1.)
+			{
+				priorityCredit-= 1.;
+				generated = source.generate(c, 0);
+			}
+			else generated = source.generate(c);
+			
+			if(!generated) break;
+			++results.sent;
+			for(unsigned s = 0; s < params.sinks; ++s)
+				paths[s]->channels[0]->send(c, tick);
+		}
+		
+		clock_t middle = clock();
+		encodeTime+= middle - start;
+		
+		// Forward along paths
+		for(unsigned s = 0; s < params.sinks; ++s)
+		{
+			Path *path = paths[s];
+			if(path->decoded == params.symbols)
+				continue;
+			
+			for(unsigned h = 0; h < params.hops; ++h)
+			{
+				// Relays recode one packet per received packet
+				while(path->channels[h]->receive(c, tick))
+				{
+					path->relays[h]->solve(c);
+					if(path->relays[h]->generate(r))
+						path->channels[h+1]->send(r, tick);
+				}
+			}
+			
+			unsigned count = path->sink.decodedCount();
+			while(path->channels[params.hops]->receive(c, tick))
+			{
+				++path->received;
+				path->sink.solve(c);
+			}
+			
+			if(path->sink.decodedCount() != count)
+			{
+				path->sink.getDecoded(decoded);
+				for(std::list<const nc::Rlc::Combination*>::iterator it = decoded.begin(); it != decoded.end(); ++it)
+				{
+					unsigned i = (*it)->firstComponent();
+					if(i < params.symbols && path->decodedAt[i] < 0)
+					{
+						path->decodedAt[i] = tick;
+						++path->decoded;
+					}
+				}
+				
+				if(params.priority && path->prefixAt < 0 && path->sink.decodedPrefix() >= params.priority)
+					path->prefixAt = tick;
+				
+				if(path->decoded == params.symbols)
+					++finished;
+			}
+		}
+		
+		decodeTime+= clock() - middle;
+		
+		// Save and restore sinks in place, decoding must resume from the snapshot
+		if(!params.checkpoint.empty() && (tick+1) % params.checkpointInterval == 0)
+		{
+			for(unsigned s = 0; s < params.sinks; ++s)
+			{
+				Path *path = paths[s];
+				if(path->decoded == params.symbols)
+					continue;
+				
+				path->sink.save(params.checkpoint);
+				path->sink.load(params.checkpoint);
+			}
+		}
+	}
+	
+	// Collect results and check decoded data
+	for(unsigned s = 0; s < params.sinks; ++s)
+	{
+		Path *path = paths[s];
+		results.received+= path->received;
+		if(params.priority && path->prefixAt >= 0)
+			results.prefixLatencies.push_back(path->prefixAt - arrivals[params.priority-1]);
+		
+		path->sink.getDecoded(decoded);
+		std::vector<const nc::Rlc::Combination*> rows(params.symbols, (const nc::Rlc::Combination*)NULL);
+		for(std::list<const nc::Rlc::Combination*>::iterator it = decoded.begin(); it != decoded.end(); ++it)
+			if((*it)->firstComponent() < params.symbols)
+				rows[(*it)->firstComponent()] = *it;
+		
+		for(unsigned i = 0; i < params.symbols; ++i)
+		{
+			if(!rows[i] || path->decodedAt[i] < 0)
+			{
+				++results.errors;
+				continue;
+			}
+			
+			if(rows[i]->size() != symbols[i].size()
+				|| std::memcmp(rows[i]->data(), symbols[i].data(), symbols[i].size()) != 0)
+			{
+				++results.errors;
+				continue;
+			}
+			
+			++results.delivered;
+			results.latencies.push_back(path->decodedAt[i] - arrivals[i]);
+		}
+		
+		delete path;
+	}
+	
+	results.ticks+= tick;
+	results.encodeTime+= seconds(encodeTime);
+	results.decodeTime+= seconds(decodeTime);
+}
+
+unsigned percentile(const std::vector<unsigned> &sorted, double p)
+{
+	if(sorted.empty()) return 0;
+	size_t i = size_t(p*(sorted.size()-1) + 0.5);
+	return sorted[std::min(i, sorted.size()-1)];
+}
+
+void printLatencies(const char *title, std::vector<unsigned> &latencies)
+{
+	std::sort(latencies.begin(), latencies.end());
+	double mean = 0.;
+	for(size_t i = 0; i < latencies.size(); ++i)
+		mean+= latencies[i];
+	if(!latencies.empty()) mean/= latencies.size();
+	
+	std::cout << title << " (ticks): mean " << mean
+		<< ", p50 " << percentile(latencies, 0.50)
+		<< ", p90 " << percentile(latencies, 0.90)
+		<< ", p99 " << percentile(latencies, 0.99)
+		<< ", max " << (latencies.empty() ? 0 : latencies.back()) << std::endl;
+}
+
+void report(const Params &params, Results &results)
+{
+	const double expected = double(params.symbols)*params.sinks*params.runs;
+	const double bytes = double(results.delivered)*params.size;
+	
+	std::cout << "Delivered: " << results.delivered << "/" << expected << " symbols, "
+		<< results.errors << " errors" << std::endl;
+	std::cout << "Packets: " << results.sent << " sent, " << results.received << " received" << std::endl;
+	std::cout << "Overhead: " << (expected > 0 ? results.received/expected - 1. : 0.)
+		<< " (received per symbol minus one)" << std::endl;
+	printLatencies("Latency", results.latencies);
+	if(params.priority)
+	{
+		std::cout << "Prefix of " << params.priority << " symbols decoded: "
+			<< results.prefixLatencies.size() << "/" << params.sinks*params.runs << std::endl;
+		printLatencies("Prefix latency", results.prefixLatencies);
+	}
+	
+	std::cout << "Duration: " << results.ticks << " ticks" << std::endl;
+	if(bytes > 0)
+	{
+		std::cout << "CPU time per delivered byte: encode " << results.encodeTime*1e9/bytes
+			<< " ns, decode " << results.decodeTime*1e9/bytes << " ns" << std::endl;
+	}
+}
+
+void usage(const char *name)
+{
+	std::cerr << "Usage: " << name << " [options]" << std::endl
+		<< "  --symbols N        number of source symbols (default 64)" << std::endl
+		<< "  --size N           symbol size in bytes (default 1024)" << std::endl
+		<< "  --interval N       ticks between symbol arrivals at source (default 0)" << std::endl
+		<< "  --rate R           coded packets sent per tick (default 1)" << std::endl
+		<< "  --sinks N          number of sinks (default 1)" << std::endl
+		<< "  --hops N           number of relays on each path (default 0)" << std::endl
+		<< "  --loss P           Bernoulli loss probability (default 0)" << std::endl
+		<< "  --ge P R B         Gilbert-Elliott channel: good to bad P, bad to good R, loss in bad state B" << std::endl
+		<< "  --delay N          propagation delay in ticks (default 1)" << std::endl
+		<< "  --reorder P J      delay a packet by up to J additional ticks with probability P" << std::endl
+		<< "  --duplicate P      duplication probability (default 0)" << std::endl
+		<< "  --runs N           number of runs (default 1)" << std::endl
+		<< "  --max-ticks N      maximum duration of a run (default 1000000)" << std::endl
+		<< "  --block            decode the whole generation at once at sinks" << std::endl
+		<< "  --priority K F     first K symbols are high priority, a fraction F of packets only covers them" << std::endl
+		<< "  --checkpoint F N   save sinks to snapshot file F and reload them every N ticks" << std::endl
+		<< "  --seed S           fixed seed for reproducible runs (default random)" << std::endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	Params params;
+	params.symbols = 64;
+	params.size = 1024;
+	params.interval = 0;
+	params.rate = 1.;
+	params.sinks = 1;
+	params.hops = 0;
+	params.runs = 1;
+	params.maxTicks = 1000000;
+	params.block = false;
+	params.priority = 0;
+	params.priorityRatio = 0.;
+	params.checkpointInterval = 0;
+	params.loss = 0.;
+	params.lossBad = 0.;
+	params.goodToBad = 0.;
+	params.badToGood = 1.;
+	params.delay = 1;
+	params.reorder = 0.;
+	params.jitter = 0;
+	params.duplicate = 0.;
+	params.seed = nc::uint64_t(time(NULL));
+	params.fixedSeed = false;
+	
+	for(int i = 1; i < argc; ++i)
+	{
+		std::string arg(argv[i]);
+		int remaining = argc - i - 1;
+		
+		if(arg == "--symbols" && remaining >= 1) params.symbols = std::atoi(argv[++i]);
+		else if(arg == "--size" && remaining >= 1) params.size = std::atoi(argv[++i]);
+		else if(arg == "--interval" && remaining >= 1) params.interval = std::atoi(argv[++i]);
+		else if(arg == "--rate" && remaining >= 1) params.rate = std::atof(argv[++i]);
+		else if(arg == "--sinks" && remaining >= 1) params.sinks = std::atoi(argv[++i]);
+		else if(arg == "--hops" && remaining >= 1) params.hops = std::atoi(argv[++i]);
+		else if(arg == "--loss" && remaining >= 1) params.loss = std::atof(argv[++i]);
+		else if(arg == "--ge" && remaining >= 3)
+		{
+			params.goodToBad = std::atof(argv[++i]);
+			params.badToGood = std::atof(argv[++i]);
+			params.lossBad = std::atof(argv[++i]);
+		}
+		else if(arg == "--delay" && remaining >= 1) params.delay = std::atoi(argv[++i]);
+		else if(arg == "--reorder" && remaining >= 2)
+		{
+			params.reorder = std::atof(argv[++i]);
+			params.jitter = std::atoi(argv[++i]);
+		}
+		else if(arg == "--duplicate" && remaining >= 1) params.duplicate = std::atof(argv[++i]);
+		else if(arg == "--runs" && remaining >= 1) params.runs = std::atoi(argv[++i]);
+		else if(arg == "--max-ticks" && remaining >= 1) params.maxTicks = std::atoi(argv[++i]);
+		else if(arg == "--block") params.block = true;
+		else if(arg == "--priority" && remaining >= 2)
+		{
+			params.priority = std::atoi(argv[++i]);
+			params.priorityRatio = std::atof(argv[++i]);
+		}
+		else if(arg == "--checkpoint" && remaining >= 2)
+		{
+			params.checkpoint = argv[++i];
+			params.checkpointInterval = std::atoi(argv[++i]);
+		}
+		else if(arg == "--seed" && remaining >= 1)
+		{
+			params.seed = std::strtoull(argv[++i], NULL, 10);
+			params.fixedSeed = true;
+		}
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	
+	if(params.rate <= 0. || params.sinks == 0 || params.runs == 0
+		|| params.priority > params.symbols || params.priorityRatio < 0. || params.priorityRatio > 1.
+		|| (!params.checkpoint.empty() && params.checkpointInterval == 0))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	
+	nc::Rlc::Init();	// Global RLC initialization
+	
+	std::cout << "Seed: " << params.seed << (params.fixedSeed ? " (fixed)" : "") << std::endl;
+	
+	Results results;
+	for(unsigned i = 0; i < params.runs; ++i)
+		run(params, params.seed + i, results);
+	
+	report(params, results);
+	
+	nc::Rlc::Cleanup();	// Global RLC cleanup
+	return results.errors ? 2 : 0;
+}
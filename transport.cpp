@@ -0,0 +1,447 @@
+/****************************************************************************
+ *   Copyright (C) 2013-2016 by Paul-Louis Ageneau                          *
+ *   paul-louis (at) ageneau (dot) org                                      *
+ *                                                                          *
+ *   This file is part of NC-Simple.                                        *
+ *                                                                          *
+ *   NC-Simple is free software: you can redistribute it and/or modify      *
+ *   it under the terms of the GNU General Public License as published by   *
+ *   the Free Software Foundation, either version 3 of the License, or      *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   NC-Simple is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           *
+ *   GNU General Public License for more details.                           *
+ *                                                                          *
+ *   You should have received a copy of the GNU General Public License      *
+ *   along with NC-Simple. If not, see <http://www.gnu.org/licenses/>.      *
+ ****************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	// for recvmmsg and sendmmsg
+#endif
+
+#include "transport.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+namespace nc
+{
+
+// Datagram types
+static const char TypeCombination = 'C';
+static const char TypeFeedback = 'F';
+
+// Combination header: type, sequence number, first component, components count
+static const size_t HeaderSize = 1 + 4 + 4 + 2;
+static const unsigned DefaultMaxComponents = 65536;
+
+static void writeUint32(char *p, uint32_t v)
+{
+	for(int i = 0; i < 4; ++i) p[i] = char(v >> (8*i));
+}
+
+static void writeUint16(char *p, uint16_t v)
+{
+	for(int i = 0; i < 2; ++i) p[i] = char(v >> (8*i));
+}
+
+static uint32_t readUint32(const char *p)
+{
+	uint32_t v = 0;
+	for(int i = 0; i < 4; ++i) v|= uint32_t(uint8_t(p[i])) << (8*i);
+	return v;
+}
+
+static uint16_t readUint16(const char *p)
+{
+	return uint16_t(uint8_t(p[0]) | (uint8_t(p[1]) << 8));
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return double(ts.tv_sec) + double(ts.tv_nsec)*1e-9;
+}
+
+static void resolve(const std::string &host, unsigned short port, struct sockaddr_in &addr)
+{
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if(inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+		throw std::runtime_error("Invalid IPv4 address: " + host);
+}
+
+Pacer::Pacer(double rate, double minRate, double maxRate) :
+	mRate(rate),
+	mMinRate(minRate),
+	mMaxRate(maxRate),
+	mTokens(0.),
+	mLast(now()),
+	mLastSent(0),
+	mLastRank(0)
+{
+
+}
+
+Pacer::~Pacer(void)
+{
+
+}
+
+unsigned Pacer::allowance(unsigned max)
+{
+	refill();
+	return unsigned(std::min(mTokens, double(max)));
+}
+
+void Pacer::consume(unsigned count)
+{
+	mTokens = std::max(mTokens - count, 0.);
+}
+
+void Pacer::feedback(unsigned sent, unsigned rank)
+{
+	// Wait for enough packets to estimate the delivery ratio
+	const unsigned window = 32;
+	if(rank < mLastRank || sent < mLastSent) 
+	{
+		mLastSent = sent;
+		mLastRank = rank;
+		return;
+	}
+	
+	unsigned deltaSent = sent - mLastSent;
+	if(deltaSent < window)
+		return;
+	
+	// Grow the rate by an eighth while the sink keeps up, scale it down by the delivery ratio on losses
+	double ratio = double(rank - mLastRank) / deltaSent;
+	if(ratio >= 0.9) mRate+= mRate/8;
+	else mRate*= std::max(ratio, 0.5);
+	
+	mRate = std::min(std::max(mRate, mMinRate), mMaxRate);
+	mLastSent = sent;
+	mLastRank = rank;
+}
+
+int Pacer::delay(void) const
+{
+	if(mTokens >= 1.) return 0;
+	return int((1. - mTokens)*1000./mRate) + 1;
+}
+
+double Pacer::rate(void) const
+{
+	return mRate;
+}
+
+void Pacer::refill(void)
+{
+	// Token bucket with a burst of at most 100ms of traffic
+	double t = now();
+	mTokens = std::min(mTokens + (t - mLast)*mRate, std::max(mRate/10, 1.));
+	mLast = t;
+}
+
+Transport::Transport(unsigned short port, const std::string &host, unsigned batch, size_t mtu) :
+	mSock(-1),
+	mEpoll(-1),
+	mBatch(std::max(batch, 1u)),
+	mMtu(mtu),
+	mBuffers(mBatch*mtu),
+	mMessages(mBatch),
+	mVectors(mBatch),
+	mIncoming(mBatch),
+	mSent(0),
+	mReceived(0),
+	mRemoteRank(0),
+	mRemoteSequence(0),
+	mMaxComponents(DefaultMaxComponents)
+{
+	struct sockaddr_in addr;
+	resolve(host, port, addr);
+	
+	mSock = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(mSock < 0)
+		throw std::runtime_error(std::string("Socket creation failed: ") + std::strerror(errno));
+	
+	// Large buffers absorb bursts of batches
+	int bufferSize = 4*1024*1024;
+	::setsockopt(mSock, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+	::setsockopt(mSock, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+	
+	if(::bind(mSock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+	{
+		int err = errno;
+		::close(mSock);
+		throw std::runtime_error(std::string("Socket binding failed: ") + std::strerror(err));
+	}
+	
+	mEpoll = ::epoll_create1(EPOLL_CLOEXEC);
+	if(mEpoll < 0)
+	{
+		int err = errno;
+		::close(mSock);
+		throw std::runtime_error(std::string("Epoll creation failed: ") + std::strerror(err));
+	}
+	
+	struct epoll_event event;
+	std::memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = mSock;
+	::epoll_ctl(mEpoll, EPOLL_CTL_ADD, mSock, &event);
+	
+	// Messages point once and for all to the reused buffers
+	for(unsigned i = 0; i < mBatch; ++i)
+	{
+		mVectors[i].iov_base = &mBuffers[i*mMtu];
+		mVectors[i].iov_len = mMtu;
+		std::memset(&mMessages[i], 0, sizeof(struct mmsghdr));
+		mMessages[i].msg_hdr.msg_iov = &mVectors[i];
+		mMessages[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+Transport::~Transport(void)
+{
+	::close(mEpoll);
+	::close(mSock);
+}
+
+void Transport::connect(const std::string &host, unsigned short port)
+{
+	struct sockaddr_in addr;
+	resolve(host, port, addr);
+	
+	if(::connect(mSock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+		throw std::runtime_error(std::string("Socket connection failed: ") + std::strerror(errno));
+}
+
+unsigned short Transport::port(void) const
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	if(::getsockname(mSock, reinterpret_cast<struct sockaddr*>(&addr), &len) < 0)
+		throw std::runtime_error(std::string("Unable to get socket name: ") + std::strerror(errno));
+	
+	return ntohs(addr.sin_port);
+}
+
+bool Transport::wait(int timeout)
+{
+	struct epoll_event event;
+	int n;
+	do n = ::epoll_wait(mEpoll, &event, 1, timeout);
+	while(n < 0 && errno == EINTR);
+	
+	if(n < 0)
+		throw std::runtime_error(std::string("Epoll wait failed: ") + std::strerror(errno));
+	
+	return n > 0;
+}
+
+unsigned Transport::send(Rlc &source, unsigned count)
+{
+	unsigned total = 0;
+	while(total < count)
+	{
+		// Fill a batch
+		unsigned n = 0;
+		while(n < std::min(count - total, mBatch))
+		{
+			if(!source.generate(mCombination)) break;
+			mVectors[n].iov_len = serialize(mCombination, source.generatedCount(), &mBuffers[n*mMtu]);
+			++n;
+		}
+		
+		if(!n) break;
+		
+		int ret;
+		do ret = ::sendmmsg(mSock, &mMessages[0], n, 0);
+		while(ret < 0 && errno == EINTR);
+		
+		if(ret < 0)
+		{
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED) break;
+			throw std::runtime_error(std::string("Sending failed: ") + std::strerror(errno));
+		}
+		
+		total+= ret;
+		if(unsigned(ret) < n) break;	// buffer full
+	}
+	
+	mSent+= total;
+	return total;
+}
+
+bool Transport::pump(Rlc &source, int timeout)
+{
+	if(timeout > 0 && mPacer.delay() > 0)
+		wait(std::min(timeout, mPacer.delay()));
+	
+	receive(source);	// handle feedback
+	if(source.isComplete())
+		return false;	// sink is full
+	
+	unsigned count = mPacer.allowance(mBatch);
+	if(count)
+		mPacer.consume(send(source, count));
+	
+	return true;
+}
+
+void Transport::setMaxComponents(unsigned count)
+{
+	mMaxComponents = count;
+}
+
+unsigned Transport::remoteRank(void) const
+{
+	return mRemoteRank;
+}
+
+unsigned Transport::receive(Rlc &rlc)
+{
+	unsigned innovative = 0;
+	unsigned combinations = 0;
+	while(true)
+	{
+		for(unsigned i = 0; i < mBatch; ++i)
+			mVectors[i].iov_len = mMtu;
+		
+		int ret;
+		do ret = ::recvmmsg(mSock, &mMessages[0], mBatch, MSG_DONTWAIT, NULL);
+		while(ret < 0 && errno == EINTR);
+		
+		if(ret < 0)
+		{
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED) break;
+			throw std::runtime_error(std::string("Receiving failed: ") + std::strerror(errno));
+		}
+		
+		unsigned n = 0;
+		for(int i = 0; i < ret; ++i)
+		{
+			const char *buffer = &mBuffers[i*mMtu];
+			size_t size = mMessages[i].msg_len;
+			if(!size || (mMessages[i].msg_hdr.msg_flags & MSG_TRUNC)) continue;	// drop datagrams larger than the MTU
+			
+			if(buffer[0] == TypeCombination)
+			{
+				unsigned sequence;
+				if(deserialize(buffer, size, mIncoming[n], sequence))
+				{
+					mRemoteSequence = std::max(mRemoteSequence, sequence);
+					++n;
+				}
+			}
+			else if(buffer[0] == TypeFeedback)
+			{
+				if(!mFeedback.deserialize(buffer + 1, size - 1)) continue;
+				rlc.acknowledge(mFeedback);
+				mRemoteRank = mFeedback.rank();
+				mPacer.feedback(mSent, mRemoteRank);
+			}
+		}
+		
+		// Solve the whole batch at once
+		innovative+= rlc.solve(&mIncoming[0], n);
+		combinations+= n;
+		
+		if(unsigned(ret) < mBatch) break;
+	}
+	
+	mReceived+= combinations;
+	
+	// Acknowledge once per batch
+	if(combinations)
+		sendFeedback(rlc);
+	
+	return innovative;
+}
+
+unsigned Transport::sentCount(void) const
+{
+	return mSent;
+}
+
+unsigned Transport::receivedCount(void) const
+{
+	return mReceived;
+}
+
+size_t Transport::serialize(const Rlc::Combination &c, unsigned sequence, char *buffer) const
+{
+	const unsigned first = c.firstComponent();
+	const unsigned count = c.componentsCount();
+	const size_t size = HeaderSize + count + c.codedSize();
+	if(count > 0xFFFF || size > mMtu)
+		throw std::runtime_error("Combination too large for transport MTU");
+	
+	buffer[0] = TypeCombination;
+	writeUint32(buffer + 1, sequence);
+	writeUint32(buffer + 5, first);
+	writeUint16(buffer + 9, uint16_t(count));
+	
+	char *p = buffer + HeaderSize;
+	for(unsigned i = 0; i < count; ++i)
+		*p++ = char(c.coeff(first + i));
+	
+	std::copy(c.data(), c.data() + c.codedSize(), p);
+	return size;
+}
+
+bool Transport::deserialize(const char *buffer, size_t size, Rlc::Combination &c, unsigned &sequence) const
+{
+	if(size < HeaderSize)
+		return false;
+	
+	sequence = readUint32(buffer + 1);
+	const unsigned first = readUint32(buffer + 5);
+	const unsigned count = readUint16(buffer + 9);
+	if(size < HeaderSize + count)
+		return false;
+	
+	// A stray packet must not grow the sink beyond the expected generation
+	if(first >= mMaxComponents || count > mMaxComponents - first)
+		return false;
+	
+	c.clear();
+	const char *p = buffer + HeaderSize;
+	for(unsigned i = 0; i < count; ++i)
+		c.addComponent(first + i, uint8_t(p[i]));
+	
+	c.setCodedData(p + count, size - HeaderSize - count);
+	return !c.isNull();
+}
+
+void Transport::sendFeedback(const Rlc &sink)
+{
+	// Missing pivots bitmap is truncated to the MTU if necessary
+	sink.feedback(mFeedback, true);
+	mFeedback.setSequence(mRemoteSequence);	// so the source does not resend components in flight
+	char *buffer = &mBuffers[0];
+	buffer[0] = TypeFeedback;
+	size_t size = 1 + mFeedback.serialize(buffer + 1, mMtu - 1);
+	
+	// Feedback is best effort, a lost acknowledgement is superseded by the next one
+	::send(mSock, buffer, size, MSG_DONTWAIT);
+}
+
+}
@@ -0,0 +1,110 @@
+/****************************************************************************
+ *   Copyright (C) 2013-2016 by Paul-Louis Ageneau                          *
+ *   paul-louis (at) ageneau (dot) org                                      *
+ *                                                                          *
+ *   This file is part of NC-Simple.                                        *
+ *                                                                          *
+ *   NC-Simple is free software: you can redistribute it and/or modify      *
+ *   it under the terms of the GNU General Public License as published by   *
+ *   the Free Software Foundation, either version 3 of the License, or      *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   NC-Simple is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           *
+ *   GNU General Public License for more details.                           *
+ *                                                                          *
+ *   You should have received a copy of the GNU General Public License      *
+ *   along with NC-Simple. If not, see <http://www.gnu.org/licenses/>.      *
+ ****************************************************************************/
+
+#ifndef NC_TRANSPORT_H
+#define NC_TRANSPORT_H
+
+#include "rlc.h"
+
+#include <string>
+#include <vector>
+
+struct mmsghdr;
+struct iovec;
+
+namespace nc
+{
+
+// Rate controller driven by sink feedback
+class Pacer
+{
+public:
+	Pacer(double rate = 100000., double minRate = 1000., double maxRate = 10000000.);
+	~Pacer(void);
+	
+	unsigned allowance(unsigned max);		// Return number of packets that can be sent now
+	void consume(unsigned count);			// Account for sent packets
+	void feedback(unsigned sent, unsigned rank);	// Adapt rate from total sent count and acknowledged rank
+	int delay(void) const;				// Return milliseconds until next packet can be sent
+	double rate(void) const;			// Return current rate in packets per second
+	
+private:
+	void refill(void);
+
+	double mRate, mMinRate, mMaxRate;
+	double mTokens;
+	double mLast;
+	unsigned mLastSent;
+	unsigned mLastRank;
+};
+
+// Batched UDP transport for combinations (Linux only)
+class Transport
+{
+public:
+	Transport(unsigned short port = 0, const std::string &host = "0.0.0.0", unsigned batch = 64, size_t mtu = 1472);
+	~Transport(void);
+	
+	void connect(const std::string &host, unsigned short port);	// Set remote peer
+	unsigned short port(void) const;				// Return local port
+	bool wait(int timeout);					// Wait for incoming datagrams, timeout in milliseconds
+	
+	// Source
+	unsigned send(Rlc &source, unsigned count);	// Generate and send up to count combinations, return sent count
+	bool pump(Rlc &source, int timeout = 0);	// Handle feedback and send paced combinations, return false once the sink is full
+	unsigned remoteRank(void) const;		// Return last rank acknowledged by the sink
+	Pacer &pacer(void) { return mPacer; }
+	
+	// Sink
+	unsigned receive(Rlc &rlc);			// Receive pending datagrams and solve, return innovative count
+	void setMaxComponents(unsigned count);		// Drop combinations with components beyond count (default 65536)
+	
+	unsigned sentCount(void) const;			// Return total sent combinations count
+	unsigned receivedCount(void) const;		// Return total received combinations count
+
+private:
+	size_t serialize(const Rlc::Combination &c, unsigned sequence, char *buffer) const;
+	bool deserialize(const char *buffer, size_t size, Rlc::Combination &c, unsigned &sequence) const;
+	void sendFeedback(const Rlc &sink);
+
+	int mSock;
+	int mEpoll;
+	unsigned mBatch;
+	size_t mMtu;
+	
+	// Reused buffers
+	std::vector<char> mBuffers;
+	std::vector<struct mmsghdr> mMessages;
+	std::vector<struct iovec> mVectors;
+	Rlc::Combination mCombination;
+	std::vector<Rlc::Combination> mIncoming;
+	Rlc::Feedback mFeedback;
+	
+	Pacer mPacer;
+	unsigned mSent;
+	unsigned mReceived;
+	unsigned mRemoteRank;
+	unsigned mRemoteSequence;	// latest sequence number received from the source
+	unsigned mMaxComponents;
+};
+
+}
+
+#endif
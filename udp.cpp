@@ -0,0 +1,99 @@
+/****************************************************************************
+ *   Copyright (C) 2013-2016 by Paul-Louis Ageneau                          *
+ *   paul-louis (at) ageneau (dot) org                                      *
+ *                                                                          *
+ *   This file is part of NC-Simple.                                        *
+ *                                                                          *
+ *   NC-Simple is free software: you can redistribute it and/or modify      *
+ *   it under the terms of the GNU General Public License as published by   *
+ *   the Free Software Foundation, either version 3 of the License, or      *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   NC-Simple is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           *
+ *   GNU General Public License for more details.                           *
+ *                                                                          *
+ *   You should have received a copy of the GNU General Public License      *
+ *   along with NC-Simple. If not, see <http://www.gnu.org/licenses/>.      *
+ ****************************************************************************/
+
+// Loopback transfer: a source and a sink exchange combinations over UDP on 127.0.0.1
+
+#include "rlc.h"
+#include "transport.h"
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+int main(int argc, char **argv)
+{
+	unsigned symbols = (argc > 1 ? std::atoi(argv[1]) : 256);
+	size_t size = (argc > 2 ? std::atoi(argv[2]) : 1024);
+	bool systematic = (argc > 3 && std::string(argv[3]) == "systematic");
+	
+	nc::Rlc::Init();	// Global RLC initialization
+	
+	int status = 0;
+	try {
+		// Source symbols
+		std::vector<std::string> data(symbols);
+		nc::Rlc source(nc::uint64_t(time(NULL)), systematic);
+		for(unsigned i = 0; i < symbols; ++i)
+		{
+			data[i].resize(size);
+			for(size_t j = 0; j < size; ++j)
+				data[i][j] = char(std::rand());
+			source.add(data[i].data(), data[i].size());
+		}
+		
+		nc::Transport sourceTransport(0, "127.0.0.1", 64, 64 + symbols + size);
+		nc::Transport sinkTransport(0, "127.0.0.1", 64, 64 + symbols + size);
+		sourceTransport.connect("127.0.0.1", sinkTransport.port());
+		sinkTransport.connect("127.0.0.1", sourceTransport.port());
+		sinkTransport.setMaxComponents(symbols);
+		
+		nc::Rlc sink;
+		const double timeout = 10.;
+		clock_t start = clock();
+		time_t deadline = time(NULL) + time_t(timeout);
+		
+		// Single-threaded event loop driving both ends
+		while(sourceTransport.pump(source) && time(NULL) < deadline)
+		{
+			if(sinkTransport.wait(1))
+				sinkTransport.receive(sink);
+		}
+		
+		double elapsed = double(clock() - start) / CLOCKS_PER_SEC;
+		
+		// Check decoded data
+		std::list<const nc::Rlc::Combination*> decoded;
+		sink.getDecoded(decoded);
+		unsigned errors = symbols - decoded.size();
+		for(std::list<const nc::Rlc::Combination*>::iterator it = decoded.begin(); it != decoded.end(); ++it)
+		{
+			const std::string &d = data[(*it)->firstComponent()];
+			if((*it)->size() != d.size() || std::memcmp((*it)->data(), d.data(), d.size()) != 0)
+				++errors;
+		}
+		
+		std::cout << "Decoded: " << sink.decodedCount() << "/" << symbols << ", " << errors << " errors" << std::endl;
+		std::cout << "Packets: " << sourceTransport.sentCount() << " sent, " << sinkTransport.receivedCount() << " received" << std::endl;
+		std::cout << "CPU time: " << elapsed << " s, " << (elapsed > 0 ? sinkTransport.receivedCount()/elapsed : 0.)
+			<< " packets/s, final rate " << sourceTransport.pacer().rate() << " packets/s" << std::endl;
+		
+		status = (errors ? 2 : 0);
+	}
+	catch(const std::exception &e)
+	{
+		std::cerr << "Error: " << e.what() << std::endl;
+		status = 1;
+	}
+	
+	nc::Rlc::Cleanup();	// Global RLC cleanup
+	return status;
+}